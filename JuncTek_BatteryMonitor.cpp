@@ -1,20 +1,48 @@
   #include "JuncTek_BatteryMonitor.h"
+#include "JuncTek_DerivedMetrics.h"
+#include "JuncTek_Pack.h"
 
 BatteryMonitor::BatteryMonitor(){
-//empty constructor
+  metrics=NULL;
+  pack=NULL;
+  packMember=0;
+  setValues.presetCapacity=0;
+  baudRate=0;
+  sendTime=0;
+  // typical message lengths, replaced by the measured ones after the first transaction
+  replyLength[0]=40;    // :r00
+  replyLength[1]=90;    // :r50
+  replyLength[2]=100;   // :r51
+  replyLength[3]=24;    // write commands
+  for(int i=0;i<4;i++){
+    requestLength[i]=16;
+    turnaround[i]=0;
+    turnaroundKnown[i]=false;
+    timeoutBackoff[i]=0;
+  }
+  readTime=0;
+  pollTime=0;
+  pollInterval=0;
+  wireUsage=0;
+  usageWindowStart=0;
+  usagePermille=0;
 }
 BatteryMonitor::~BatteryMonitor(){
   
 }
 
-void BatteryMonitor::begin(int address, Stream &serialDevice){
+void BatteryMonitor::begin(int address, Stream &serialDevice, unsigned long baud){
   bm_serial=&serialDevice;
+  baudRate=baud;
+  usageWindowStart=millis();
   bm_address=address;
   setValues.deviceAddress=bm_address;
   basicInfo.deviceAddress=bm_address;
   measuredValues.deviceAddress=bm_address;
   cacheTime=CACHE_TIME; 
   getBasicInfo();
+  // the set values provide the preset capacity the derived metrics are relative to
+  getSetValues();
   
   //Serial.printf("=== Battery Monitor basic info ===\nmax Voltage: %i\nmax Current: %i\nSensor Type: %i\nVersion    : %i\nSerial Nr : %i",  basicInfo.maxVoltage, basicInfo.maxCurrent,basicInfo.sensorType,basicInfo.deviceVersion,basicInfo.deviceSerialNumber);
   getMeasuredValues();
@@ -114,7 +142,7 @@ bool BatteryMonitor::setRelayType(int relayType){
 
 void BatteryMonitor::resetFactorySettings(){
   sendMessage(bm_address, BM_F_ResumeFctSettings, 1);
-  String message=readMessage();
+  String message=readMessage(BM_F_ResumeFctSettings);
 }
 bool BatteryMonitor::setCurrentMultiplier(int currentMultiplier){
   return sendCommand(bm_address, BM_F_SetCurrMult, currentMultiplier);
@@ -229,6 +257,17 @@ float BatteryMonitor::getOverPowerProtectionPower(){
   return setValues.OPPPower;
 }
 
+const measuredValues_t &BatteryMonitor::getMeasuredSnapshot(){
+  getMeasuredValues();
+  return measuredValues;
+}
+const setValues_t &BatteryMonitor::getSetSnapshot(){
+  getSetValues();
+  return setValues;
+}
+const basicInfo_t &BatteryMonitor::getBasicInfoSnapshot(){
+  return basicInfo;
+}
 
 void BatteryMonitor::getBasicInfo(){
   // result syntax: :r00=<addr>,<checksum>,<sensor_type:1><voltage:1><amperage:2>,<firmware_version>,<machine_serial_nr>,
@@ -237,7 +276,8 @@ void BatteryMonitor::getBasicInfo(){
   debug("getting basic Info");
    
   sendMessage(bm_address, BM_F_ReadBasicInf, 1);
-  message=readMessage();
+  message=readMessage(BM_F_ReadBasicInf);
+  if(message.length()==0) return;     // no valid reply, keep the previous values
 
   debug("get sensor type, max voltage and max current");
   field=getStringField(message,3);
@@ -260,10 +300,29 @@ void BatteryMonitor::getBasicInfo(){
   basicInfo.deviceSerialNumber=getStringField(message,5).toInt();
 }
 void BatteryMonitor::getMeasuredValues(){
-  String message;
   if(!checkCache()){
+	  readMeasuredValues();
+  }
+}
+
+bool BatteryMonitor::poll(){
+  // transactions are synchronous, once we get here the previous one has finished
+  // and the link is free. Only a poll interval set by the caller holds us back
+  if(pollInterval>0 && millis()-pollTime<(unsigned long)pollInterval) return false;
+  pollTime=millis();
+  return readMeasuredValues();
+}
+
+bool BatteryMonitor::readMeasuredValues(){
+	  String message;
 	  sendMessage(bm_address, BM_F_ReadMsrdVals, 1);
-	  message=readMessage();
+	  message=readMessage(BM_F_ReadMsrdVals);
+	  if(message.length()==0){
+	    // no valid reply, keep the previous values but don't retry
+	    // (and wait for another SERIAL_TIMEOUT) until the cache expires
+	    readTime=millis();
+	    return false;
+	  }
 	
 	  /*
 	  * :r50=<addr>,
@@ -298,13 +357,17 @@ void BatteryMonitor::getMeasuredValues(){
 	
 	  measuredValues.outputState=getStringField(message,11).toInt();
 	  measuredValues.currentDir=getStringField(message,12).toInt();
-	  measuredValues.lastReadTime=millis();
-	}
+	  readTime=millis();
+	  measuredValues.lastReadTime=readTime;
+	  if(metrics!=NULL) metrics->update(measuredValues, setValues.presetCapacity);
+	  if(pack!=NULL) pack->update(packMember, measuredValues);
+	  return true;
 }
 void BatteryMonitor::getSetValues(){
 	String message;	
 	sendMessage(bm_address, BM_F_ReadSetVals,1);
-  	message=readMessage();
+  	message=readMessage(BM_F_ReadSetVals);
+  	if(message.length()==0) return;     // no valid reply, keep the previous values
   	/*
   		 1: deviceAddress
   		 2: checksum
@@ -373,8 +436,8 @@ bool BatteryMonitor::sendCommand(int address, int command, int parameter){
 	char verb_r,verb;	
 	
 	sendMessage(bm_address, command, parameter);
-	message=readMessage();
-  command_r = message.substring(3,5).toInt();
+	message=readMessage(command);
+  command_r = message.substring(2,4).toInt();
   returncode = getStringField(message, 2).toInt();
   getSetValues();
   if(command_r == command && returncode==0){
@@ -437,44 +500,105 @@ void BatteryMonitor::sendMessage(int address, int command, int parameter){
 	default:
 		sprintf(message, ":W%02i=%i,%i,%i,\r\n", command, address, checksum(parameter), parameter);
 	}
+    // anything still waiting in the receive buffer at this point is a late reply
+    // to an earlier request or line noise, it can't be the answer to this one
+    int stale=0;
+    while(bm_serial->available()){
+      debug((char)bm_serial->read());
+      stale++;
+    }
     debug("sendMessage\nrequest:");
 	 //sprintf(message, ":%c%02i=%i,%i,%i,\r\n", dir, command, address, checksum(parameter), parameter);
 	 debug(message);
+	 int slot=replySlot(command);
+	 requestLength[slot]=strlen(message);
+	 accountBusyTime(wireTime(stale));
+	 // before print(), which may block until the UART has sent the request
+	 sendTime=micros();
 	 bm_serial->print(message);
 }
 
-String BatteryMonitor::readMessage(){   
+String BatteryMonitor::readMessage(int command){
     String _message;
-    msgState_t _msgState;
+    msgState_t _msgState=reading;
+    bool _inFrame=false;
+    int _received=0;
+    int slot=replySlot(command);
     char c;
     debug("readMessage");
-    if (_msgState==crlf){
-      //Serial.println(".....new message");
-      _message="";
-      _msgState=reading;
-    }
-    
-    if (sizeof(_message)==0) Serial.print("[start]");
-    int t_start=millis();
-    while(!bm_serial->available() && millis()-t_start < SERIAL_TIMEOUT);
-    while(bm_serial->available() && _msgState != crlf){
+    unsigned long timeout=getReplyTimeout(command);
+    unsigned long t_start=millis();
+    while(millis()-t_start < timeout){
+        if(!bm_serial->available()) continue;
+        if(_received==0){
+          // device turnaround: time to the first reply byte minus the time the request
+          // and that byte itself needed on the wire
+          long sample=(long)(micros()-sendTime)-(long)wireTime(requestLength[slot]+1);
+          if(sample<0) sample=0;
+          if(turnaroundKnown[slot] && (unsigned long)sample<turnaround[slot]){
+            turnaround[slot]-=(turnaround[slot]-sample)>>BM_TURNAROUND_DECAY;
+          }else{
+            turnaround[slot]=sample;
+            turnaroundKnown[slot]=true;
+          }
+        }
         c=bm_serial->read();
+        _received++;
         debug(c);
-        _message=_message+String(c);
-        //Serial.print(c);
-        if (c=='\r') {
+        if(c==':'){
+          // start of message. ':' never appears inside a message, so whatever
+          // has been collected so far was a fragment and is thrown away
+          _message=":";
+          _msgState=reading;
+          _inFrame=true;
+          continue;
+        }
+        if(!_inFrame) continue;      // discard bytes until the next start of message
+        _message+=c;
+        if(c=='\r'){
           _msgState=cr;
-          //Serial.print("{cr}");
+        }else if(_msgState==cr && c=='\n'){
+          _msgState=crlf;
+        }else{
+          _msgState=reading;
+        }
+        if(_msgState==crlf){
+          if(checkReply(_message, command)){
+            replyLength[slot]=_message.length();
+            timeoutBackoff[slot]=0;
+            accountBusyTime(micros()-sendTime);
+            debug("finished read message\nmessage:");
+            debug(_message);
+            return _message;
+          }
+          debug("dropping reply that doesn't match the request:");
+          debug(_message);
+          _message="";
+          _inFrame=false;
         }
-        if (_msgState==cr && c=='\n') _msgState=crlf;
-        
-        //if (_msgState==reading) Serial.print("[r]");
-        //if (_msgState==cr) Serial.print("[CR]");
-        //if (_msgState==crlf) Serial.println("[CRLF]");
     }
-    debug("finished read message\nmessage:");
-    debug(_message);
-    return _message;
+    debug("readMessage timed out");
+    // wait twice as long next time, up to SERIAL_TIMEOUT. The turnaround estimate
+    // is left alone, the next good reply resets the back off
+    if(timeout<SERIAL_TIMEOUT) timeoutBackoff[slot]++;
+    accountBusyTime(micros()-sendTime);
+    return "";
+}
+
+bool BatteryMonitor::checkReply(String &message, int command){
+  char prefix[16];
+  // :r<function>=<address>, for reads, :w<function>=<address>, for writes,
+  // must match the pending request
+  switch(command){
+    case BM_F_ReadBasicInf:
+    case BM_F_ReadMsrdVals:
+    case BM_F_ReadSetVals:
+      sprintf(prefix, ":r%02i=%i,", command, bm_address);
+      break;
+    default:
+      sprintf(prefix, ":w%02i=%i,", command, bm_address);
+  }
+  return message.startsWith(prefix);
 }
 void BatteryMonitor::setCacheTime(int cTime){
 	cacheTime=cTime;
@@ -484,8 +608,95 @@ int BatteryMonitor::getCacheTime(){
 	return cacheTime;
 }
 
+void BatteryMonitor::setPollInterval(int pInterval){
+	pollInterval=pInterval;
+}
+
+int BatteryMonitor::getPollInterval(){
+	return pollInterval;
+}
+
+void BatteryMonitor::attachMetrics(BatteryMetrics *m){
+	metrics=m;
+}
+
+void BatteryMonitor::attachPack(BatteryPack *p, int member){
+	pack=p;
+	packMember=member;
+}
+
 bool BatteryMonitor::checkCache(){
-	return(millis()-measuredValues.lastReadTime<cacheTime);
+	return(millis()-readTime<(unsigned long)cacheTime);
+}
+
+void BatteryMonitor::setBaudRate(unsigned long baud){
+	baudRate=baud;
+}
+
+unsigned long BatteryMonitor::getBaudRate(){
+	return baudRate;
+}
+
+unsigned long BatteryMonitor::getTurnaroundTime(int command){
+	return turnaround[replySlot(command)];
+}
+
+unsigned long BatteryMonitor::getTransactionTime(int command){
+	if(baudRate==0) return 0;
+	int slot=replySlot(command);
+	return wireTime(requestLength[slot]+replyLength[slot])+turnaround[slot];
+}
+
+int BatteryMonitor::getMaxPollRate(){
+	unsigned long t=getTransactionTime(BM_F_ReadMsrdVals);
+	if(t==0) return 0;
+	return 1000000UL/t;
+}
+
+float BatteryMonitor::getLinkUtilisation(){
+	rollUsageWindow();
+	return (float)usagePermille/10;
+}
+
+unsigned long BatteryMonitor::wireTime(int bytes){
+	// in us. Whole seconds and the remainder are scaled separately, bits*1000000
+	// would overflow 32 bit above ~4 kB, rest*1000 stays below baudRate*1000
+	if(baudRate==0 || bytes<=0) return 0;
+	unsigned long bits=(unsigned long)bytes*BM_BITS_PER_BYTE;
+	unsigned long rest=bits%baudRate*1000;
+	return bits/baudRate*1000000UL+rest/baudRate*1000+rest%baudRate*1000/baudRate;
+}
+
+unsigned long BatteryMonitor::getReplyTimeout(int command){
+	int slot=replySlot(command);
+	if(baudRate==0 || !turnaroundKnown[slot]) return SERIAL_TIMEOUT;
+	unsigned long t=getTransactionTime(command)*BM_TIMEOUT_MARGIN/1000+BM_TIMEOUT_SLACK;
+	for(uint8_t i=0;i<timeoutBackoff[slot] && t<SERIAL_TIMEOUT;i++) t<<=1;
+	return t<SERIAL_TIMEOUT?t:SERIAL_TIMEOUT;
+}
+
+int BatteryMonitor::replySlot(int command){
+	switch(command){
+		case BM_F_ReadBasicInf: return 0;
+		case BM_F_ReadMsrdVals: return 1;
+		case BM_F_ReadSetVals:  return 2;
+		default:                return 3;
+	}
+}
+
+void BatteryMonitor::accountBusyTime(unsigned long us){
+	rollUsageWindow();
+	wireUsage+=us;
+}
+
+void BatteryMonitor::rollUsageWindow(){
+	unsigned long elapsed=millis()-usageWindowStart;
+	if(elapsed<BM_USAGE_WINDOW) return;
+	// us of busy link per ms of window = per mille
+	usagePermille=wireUsage/elapsed;
+	if(usagePermille>1000) usagePermille=1000;
+	wireUsage=0;
+	usageWindowStart=millis();
 }
 
 void BatteryMonitor::debug(const char msg[]){
@@ -39,6 +39,19 @@
 										 // function. A higher cache time would be useful to make sure 
 										 // consistent values are being read even if the actual calls to
 										 // get the different values are spaced farther apart.
+										 // To sample as fast as the link allows, call poll() from the
+										 // main loop instead, setPollInterval(millis) limits its rate
+
+#define BM_BITS_PER_BYTE  10   // 8N1: start bit, 8 data bits, stop bit
+#define BM_TIMEOUT_MARGIN 2    // once the link is characterised, wait BM_TIMEOUT_MARGIN times the
+										 // expected transaction time plus BM_TIMEOUT_SLACK ms for a reply
+										 // instead of the full SERIAL_TIMEOUT
+#define BM_TIMEOUT_SLACK  10
+#define BM_TURNAROUND_DECAY 4  // the turnaround estimate follows a slower reply at once and
+										 // decays towards faster ones by 1/2^BM_TURNAROUND_DECAY per reply.
+										 // Each reply timeout doubles the next wait, up to SERIAL_TIMEOUT,
+										 // until a reply arrives again
+#define BM_USAGE_WINDOW   1000 // window in ms over which the link utilisation is reported
 
 #define BM_F_SetAddress   01
 #define BM_F_TurnOnOutput 10
@@ -98,7 +111,7 @@ typedef struct {
         temperature,
         outputState,
         currentDir,
-        lastReadTime;
+        lastReadTime;       // millis() of the last read, truncated to 16 bit on AVR
 
     float
         voltage,
@@ -126,6 +139,25 @@ typedef struct {
    */
 }measuredValues_t;
 
+/*
+ * Fixed point helpers for measuredValues_t, shared by BatteryMetrics and
+ * BatteryPack. The device reports the current as a magnitude and the
+ * direction in currentDir, the signed current is positive when charging.
+ */
+inline int32_t bm_toCenti(float value){
+    return (int32_t)(value*100+(value<0?-0.5f:0.5f));
+}
+inline int32_t bm_voltageCenti(const measuredValues_t &values){      // 1/100 V
+    return bm_toCenti(values.voltage);
+}
+inline int32_t bm_currentCenti(const measuredValues_t &values){      // 1/100 A, signed
+    int32_t c=bm_toCenti(values.current);
+    return values.currentDir==0?-c:c;
+}
+inline int32_t bm_remainingMah(const measuredValues_t &values){      // mAh
+    return (int32_t)(values.remainingCapacity*1000+0.5f);
+}
+
 typedef struct{
     int 
         deviceAddress,
@@ -157,6 +189,9 @@ typedef struct{
     */
 }setValues_t;
 
+class BatteryMetrics;
+class BatteryPack;
+
 class BatteryMonitor{
   public:
   
@@ -168,15 +203,22 @@ class BatteryMonitor{
     getMeasuredValues(),
     getSetValues(),
 
-  	 begin(int address, Stream &SerialDevice),
+  	 begin(int address, Stream &SerialDevice, unsigned long baud=0),
+    setBaudRate(unsigned long baud), // link speed, enables transaction time budgeting. 0: unknown
 
     setNewAddress(uint8_t newAddress),
     zeroCurrent(),
     clearAccountingData(),
     setCacheTime(int),
+    setPollInterval(int),            // minimum ms between the starts of two poll() reads, 0: back to back
+    attachMetrics(BatteryMetrics *metrics), // metrics->update() is called on every new :r50 frame, NULL to detach.
+                                            // capacity based metrics use the preset capacity read in begin()
+                                            // and refreshed by getSetValues()
+    attachPack(BatteryPack *pack, int member), // same for pack->update(member, ...)
     resetFactorySettings();
     
 	bool
+    poll(),                    // reads a new :r50 frame unless the poll interval isn't due yet, true if one was read
     setOutput(bool output),
     setOverVoltageProtection(int voltage),
     setUnderVoltageProtection(int voltage),
@@ -220,6 +262,9 @@ class BatteryMonitor{
     getVoltageScale(),
     getCurrentScale(),
     getCacheTime(),
+    getPollInterval(),
+    getCurrentDirection(),
+    getMaxPollRate(),          // :r50 transactions per second the link can carry, 0 if unknown
     getRelayType();
 
   float
@@ -233,32 +278,62 @@ class BatteryMonitor{
     getUnderVoltageProtectionVoltage(),
     getOverCurrentProtectionForwardCurrent(),
     getOverCurrentProtectionReverseCurrent(),
-    getOverPowerProtectionPower();
+    getOverPowerProtectionPower(),
+    getLinkUtilisation();      // percent of the time the link was busy with transactions (request,
+                               // device turnaround, reply) over the last BM_USAGE_WINDOW
+
+  unsigned long
+    getBaudRate(),
+    getTransactionTime(int command), // expected request + turnaround + reply time in us, 0 if unknown
+    getTurnaroundTime(int command); // measured device response delay in us
+
+  const measuredValues_t
+    &getMeasuredSnapshot();       // refreshes like the measured value getters
+  const setValues_t
+    &getSetSnapshot();            // re-reads the set values from the device
+  const basicInfo_t
+    &getBasicInfoSnapshot();
 
   private:
   String 
       getStringField(String message, int idx),
-      readMessage();
+      readMessage(int command);   // returns the first complete reply matching command, "" on timeout
   void
     sendMessage(int address, int command, int parameter),
+    accountBusyTime(unsigned long us),
+    rollUsageWindow(),
     debug(const char msg[]),
     debug(char msg[]),
     debug(char c),
     debug(String &msg),
     debug(int i);
   int
-  	 getSingleReturnValue_i();
+  	 getSingleReturnValue_i(),
+  	 replySlot(int command);
   float
   	 getSingleReturnValue_f();
+  unsigned long
+    wireTime(int bytes),
+    getReplyTimeout(int command);
   bool
+  	 readMeasuredValues(),
   	 checkCache(),
+  	 checkReply(String &message, int command),
   	 sendCommand(int address, int command, int parameter);
 
   Stream 			  *bm_serial;
   setValues_t       setValues;
   measuredValues_t  measuredValues;
   basicInfo_t       basicInfo;
-  int               bm_address, cacheTime;
+  BatteryMetrics    *metrics;
+  BatteryPack       *pack;
+  int               packMember;
+  int               bm_address, cacheTime, pollInterval;
+  unsigned long     baudRate, sendTime, readTime, pollTime, wireUsage, usageWindowStart, usagePermille;
+  unsigned long     turnaround[4];   // per replySlot(), reads and EEPROM backed writes differ
+  int               requestLength[4], replyLength[4];
+  bool              turnaroundKnown[4];
+  uint8_t           timeoutBackoff[4];   // reply timeout is doubled this many times
   //Stream            &bm_serial;
 };
 
@@ -0,0 +1,88 @@
+#include "JuncTek_DerivedMetrics.h"
+
+BatteryMetrics::BatteryMetrics(){
+  reset();
+}
+BatteryMetrics::~BatteryMetrics(){
+
+}
+
+void BatteryMetrics::reset(){
+  voltage=0;
+  current=0;
+  power=0;
+  emaCurrent=0;
+  emaPower=0;
+  windowSum=0;
+  remaining=0;
+  capacity=0;
+  deviceLifeLeft=0;
+  windowIdx=0;
+  samples=0;
+  for(int i=0;i<METRICS_WINDOW;i++){
+    window[i]=0;
+  }
+}
+
+void BatteryMetrics::update(const measuredValues_t &values, int presetCapacity){
+  voltage=bm_voltageCenti(values);
+  current=bm_currentCenti(values);
+  power=voltage*current/1000;                        // 1/100 V * 1/100 A / 1000 = 1/10 W
+  remaining=bm_remainingMah(values);
+  capacity=(int32_t)presetCapacity*100;              // 1/10 Ah -> mAh
+  deviceLifeLeft=values.batteryLifeLeft;
+
+  if(samples==0){
+    // seed the averages with the first sample instead of ramping up from 0
+    emaCurrent=current*(1<<METRICS_EMA_SHIFT);   // current can be negative, don't shift it left
+    emaPower=power*(1<<METRICS_EMA_SHIFT);
+  }else{
+    emaCurrent+=current-(emaCurrent>>METRICS_EMA_SHIFT);
+    emaPower+=power-(emaPower>>METRICS_EMA_SHIFT);
+  }
+
+  windowSum+=current-window[windowIdx];
+  window[windowIdx]=current;
+  windowIdx=(windowIdx+1)%METRICS_WINDOW;
+  if(samples<INT16_MAX) samples++;
+}
+
+float BatteryMetrics::getPower(){
+  return (float)power/10;
+}
+float BatteryMetrics::getAveragePower(){
+  return (float)(emaPower>>METRICS_EMA_SHIFT)/10;
+}
+float BatteryMetrics::getAverageCurrent(){
+  return (float)(emaCurrent>>METRICS_EMA_SHIFT)/100;
+}
+float BatteryMetrics::getWindowCurrent(){
+  int n=samples<METRICS_WINDOW?samples:METRICS_WINDOW;
+  if(n==0) return 0;
+  return (float)(windowSum/n)/100;
+}
+float BatteryMetrics::getCRate(){
+  if(capacity==0) return 0;
+  // 1/100 A * 10 = mA, mA * 1000 / mAh = 1/1000 C
+  return (float)((emaCurrent>>METRICS_EMA_SHIFT)*10*1000/capacity)/1000;
+}
+
+int BatteryMetrics::getTimeToEmpty(){
+  int32_t mA=(emaCurrent>>METRICS_EMA_SHIFT)*10;
+  if(mA>=0) return -1;
+  return (int)(remaining*60/-mA);
+}
+int BatteryMetrics::getTimeToFull(){
+  int32_t mA=(emaCurrent>>METRICS_EMA_SHIFT)*10;
+  if(mA<=0 || capacity==0) return -1;
+  if(remaining>=capacity) return 0;
+  return (int)((capacity-remaining)*60/mA);
+}
+int BatteryMetrics::getLifeLeftDrift(){
+  int tte=getTimeToEmpty();
+  if(tte<0) return 0;
+  return tte-deviceLifeLeft;
+}
+int BatteryMetrics::getSampleCount(){
+  return samples;
+}
@@ -0,0 +1,62 @@
+#ifndef _DERIVEDMETRICSH_
+#define _DERIVEDMETRICSH_
+
+#include <Arduino.h>
+#include "JuncTek_BatteryMonitor.h"
+
+#define METRICS_WINDOW    16  // number of samples in the windowed (boxcar) average
+#define METRICS_EMA_SHIFT 3   // exponential average weight, alpha = 1/2^METRICS_EMA_SHIFT
+										// 3 gives an effective time constant of ~8 samples
+
+/*
+ * Derived metrics
+ *
+ * A BatteryMetrics object is attached to a BatteryMonitor with attachMetrics().
+ * Every time a new :r50 frame has been read, update() is called once with the
+ * fresh measuredValues_t. All averages are kept in integer fixed point and cost
+ * O(1) per sample, the getters only scale the stored values, so reading any
+ * number of derived values does not cause additional work or serial traffic.
+ *
+ * Internal units are those of the bm_*() helpers in JuncTek_BatteryMonitor.h,
+ * power is kept in 1/10 W, signed like the current.
+ */
+
+class BatteryMetrics{
+  public:
+
+  BatteryMetrics();
+  ~BatteryMetrics();
+  void
+    reset(),
+    update(const measuredValues_t &values, int presetCapacity);
+
+  float
+    getPower(),                // instantaneous power in W
+    getAveragePower(),         // exponential average of the power in W
+    getAverageCurrent(),       // exponential average of the current in A
+    getWindowCurrent(),        // mean current over the last METRICS_WINDOW samples in A
+    getCRate();                // average current relative to the preset capacity (1.0 = 1C)
+
+  int
+    getTimeToEmpty(),          // minutes until empty at the average discharge current, -1 if not discharging
+    getTimeToFull(),           // minutes until full at the average charge current, -1 if not charging
+    getLifeLeftDrift(),        // getTimeToEmpty() minus the device's batteryLifeLeft, 0 if not discharging
+    getSampleCount();
+
+  private:
+  int32_t
+    voltage,                   // 1/100 V
+    current,                   // 1/100 A
+    power,                     // 1/10 W
+    emaCurrent,                // 1/100 A << METRICS_EMA_SHIFT
+    emaPower,                  // 1/10 W << METRICS_EMA_SHIFT
+    windowSum,                 // sum of window[], 1/100 A
+    remaining,                 // mAh
+    capacity,                  // mAh
+    deviceLifeLeft;            // minutes, as reported by the device
+
+  int32_t           window[METRICS_WINDOW];
+  int               windowIdx, samples;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "JuncTek_Export.h"
+#include <stddef.h>
+
+typedef struct{
+  const char *name;
+  uint8_t     offset;
+  int8_t      decimals;     // -1: int field, otherwise float field written with this many decimals
+}exportField_t;
+
+// order must match the BM_MV_*, BM_SV_* and BM_BI_* mask bits
+static const exportField_t measuredFields[]={
+  {"voltage",            offsetof(measuredValues_t, voltage),            2},
+  {"current",            offsetof(measuredValues_t, current),            2},
+  {"remainingCapacity",  offsetof(measuredValues_t, remainingCapacity),  3},
+  {"cumulativeCapacity", offsetof(measuredValues_t, cumulativeCapacity), 3},
+  {"internalResistance", offsetof(measuredValues_t, internalResistance), 2},
+  {"temperature",        offsetof(measuredValues_t, temperature),       -1},
+  {"uptime",             offsetof(measuredValues_t, uptime),            -1},
+  {"batteryLifeLeft",    offsetof(measuredValues_t, batteryLifeLeft),   -1},
+  {"outputState",        offsetof(measuredValues_t, outputState),       -1},
+  {"currentDir",         offsetof(measuredValues_t, currentDir),        -1}
+};
+static const exportField_t settingsFields[]={
+  {"OVPVoltage",             offsetof(setValues_t, OVPVoltage),              2},
+  {"UVPVoltage",             offsetof(setValues_t, UVPVoltage),              2},
+  {"OCPForwardCurrent",      offsetof(setValues_t, OCPForwardCurrent),       2},
+  {"OCPReverseCurrent",      offsetof(setValues_t, OCPReverseCurrent),       2},
+  {"OPPPower",               offsetof(setValues_t, OPPPower),                2},
+  {"protectionTemperature",  offsetof(setValues_t, protectionTemperature),  -1},
+  {"protectionRecoveryTime", offsetof(setValues_t, protectionRecoveryTime), -1},
+  {"protectionDelayTime",    offsetof(setValues_t, protectionDelayTime),    -1},
+  {"presetCapacity",         offsetof(setValues_t, presetCapacity),         -1},
+  {"voltageScale",           offsetof(setValues_t, voltageScale),           -1},
+  {"currentScale",           offsetof(setValues_t, currentScale),           -1},
+  {"relayType",              offsetof(setValues_t, relayType),              -1}
+};
+static const exportField_t infoFields[]={
+  {"maxVoltage",         offsetof(basicInfo_t, maxVoltage),         -1},
+  {"maxCurrent",         offsetof(basicInfo_t, maxCurrent),         -1},
+  {"sensorType",         offsetof(basicInfo_t, sensorType),         -1},
+  {"deviceVersion",      offsetof(basicInfo_t, deviceVersion),      -1},
+  {"deviceSerialNumber", offsetof(basicInfo_t, deviceSerialNumber), -1}
+};
+
+static const exportField_t *fieldTable(snapshotType_t type, uint8_t &count){
+  switch(type){
+    case snapshotSettings:
+      count=sizeof(settingsFields)/sizeof(settingsFields[0]);
+      return settingsFields;
+    case snapshotInfo:
+      count=sizeof(infoFields)/sizeof(infoFields[0]);
+      return infoFields;
+    default:
+      count=sizeof(measuredFields)/sizeof(measuredFields[0]);
+      return measuredFields;
+  }
+}
+
+static const char *typeName(snapshotType_t type){
+  switch(type){
+    case snapshotSettings: return "settings";
+    case snapshotInfo:     return "info";
+    default:               return "measured";
+  }
+}
+
+SnapshotWriter::SnapshotWriter(char *buffer, size_t size, exportFormat_t fmt){
+  buf=buffer;
+  bufSize=size;
+  format=fmt;
+  measurement="junctek";
+  reset();
+}
+SnapshotWriter::~SnapshotWriter(){
+
+}
+
+void SnapshotWriter::reset(){
+  len=0;
+  recordStart=0;
+  records=0;
+  overflow=false;
+  if(bufSize>0) buf[0]='\0';
+}
+
+void SnapshotWriter::setMeasurement(const char *name){
+  measurement=name;
+}
+
+bool SnapshotWriter::add(const measuredValues_t &values, uint16_t mask){
+  return addRecord(snapshotMeasured, &values, values.deviceAddress, mask);
+}
+bool SnapshotWriter::add(const setValues_t &values, uint16_t mask){
+  return addRecord(snapshotSettings, &values, values.deviceAddress, mask);
+}
+bool SnapshotWriter::add(const basicInfo_t &info, uint16_t mask){
+  return addRecord(snapshotInfo, &info, info.deviceAddress, mask);
+}
+
+bool SnapshotWriter::addHeader(snapshotType_t type, uint16_t mask){
+  if(format!=exportCsv) return true;
+  uint8_t count;
+  const exportField_t *fields=fieldTable(type, count);
+
+  recordStart=len;
+  overflow=false;
+  put("type,address");
+  for(uint8_t i=0;i<count;i++){
+    if(mask&(1<<i)){
+      put(',');
+      put(fields[i].name);
+    }
+  }
+  put('\n');
+  return endRecord();
+}
+
+const char *SnapshotWriter::c_str(){
+  return buf;
+}
+
+size_t SnapshotWriter::length(){
+  return len;
+}
+
+bool SnapshotWriter::addRecord(snapshotType_t type, const void *values, int address, uint16_t mask){
+  uint8_t count;
+  const exportField_t *fields=fieldTable(type, count);
+  bool first=true;
+
+  // a line protocol record without fields is invalid, keep all formats consistent
+  if((mask&((1<<count)-1))==0) return false;
+
+  beginRecord(type, address);
+  for(uint8_t i=0;i<count;i++){
+    if(mask&(1<<i)){
+      putField(fields[i].name, values, fields[i].offset, fields[i].decimals, first);
+      first=false;
+    }
+  }
+  switch(format){
+    case exportJson:          put("}]"); break;
+    case exportLineProtocol:
+    case exportCsv:           put('\n'); break;
+  }
+  if(endRecord()){
+    records++;
+    return true;
+  }
+  return false;
+}
+
+bool SnapshotWriter::beginRecord(snapshotType_t type, int address){
+  recordStart=len;
+  overflow=false;
+  switch(format){
+    case exportJson:
+      if(records>0){
+        len--;                  // replace the closing ']' of the previous record
+        put(",{\"type\":\"");
+      }else{
+        put("[{\"type\":\"");
+      }
+      put(typeName(type));
+      put("\",\"address\":");
+      putInt(address);
+      break;
+    case exportLineProtocol:
+      put(measurement);
+      put(",address=");
+      putInt(address);
+      put(",type=");
+      put(typeName(type));
+      put(' ');
+      break;
+    case exportCsv:
+      put(typeName(type));
+      put(',');
+      putInt(address);
+      break;
+  }
+  return !overflow;
+}
+
+bool SnapshotWriter::endRecord(){
+  if(overflow || len>=bufSize){
+    // roll back to the last complete record
+    len=recordStart;
+    if(format==exportJson && records>0) buf[len-1]=']';
+    if(bufSize>0) buf[len]='\0';
+    return false;
+  }
+  buf[len]='\0';
+  return true;
+}
+
+void SnapshotWriter::putField(const char *name, const void *values, uint8_t offset, int8_t decimals, bool first){
+  const uint8_t *p=(const uint8_t *)values+offset;
+  switch(format){
+    case exportJson:
+      put(",\"");
+      put(name);
+      put("\":");
+      break;
+    case exportLineProtocol:
+      if(!first) put(',');
+      put(name);
+      put('=');
+      break;
+    case exportCsv:
+      put(',');
+      break;
+  }
+  if(decimals<0){
+    putInt(*(const int *)p);
+    if(format==exportLineProtocol) put('i');   // integer field type
+  }else{
+    putFixed(*(const float *)p, decimals);
+  }
+}
+
+void SnapshotWriter::put(char c){
+  // keep one byte for the terminating NUL
+  if(len+1>=bufSize){
+    overflow=true;
+    return;
+  }
+  buf[len++]=c;
+}
+
+void SnapshotWriter::put(const char *s){
+  while(*s) put(*s++);
+}
+
+void SnapshotWriter::putInt(long value){
+  char digits[20];                 // enough for a 64 bit long on host builds
+  uint8_t n=0;
+  unsigned long v;
+  if(value<0){
+    put('-');
+    v=-(unsigned long)value;
+  }else{
+    v=value;
+  }
+  do{
+    digits[n++]='0'+v%10;
+    v/=10;
+  }while(v);
+  while(n) put(digits[--n]);
+}
+
+void SnapshotWriter::putFixed(float value, uint8_t decimals){
+  long scale=1;
+  for(uint8_t i=0;i<decimals;i++) scale*=10;
+  long fixed=(long)(value*scale+(value<0?-0.5f:0.5f));
+  unsigned long absFixed;
+  if(fixed<0){
+    put('-');
+    absFixed=-(unsigned long)fixed;
+  }else{
+    absFixed=fixed;
+  }
+  putInt(absFixed/scale);
+  if(decimals==0) return;
+  put('.');
+  unsigned long frac=absFixed%scale;
+  for(long d=scale/10;d>0;d/=10){
+    put('0'+(frac/d)%10);
+  }
+}
@@ -0,0 +1,117 @@
+#ifndef _BATTERYMONITOREXPORTH_
+#define _BATTERYMONITOREXPORTH_
+
+#include <Arduino.h>
+#include "JuncTek_BatteryMonitor.h"
+
+/* field masks, select which fields of a snapshot are written */
+
+// measuredValues_t
+#define BM_MV_VOLTAGE       (1<<0)
+#define BM_MV_CURRENT       (1<<1)
+#define BM_MV_REMAININGCAPA (1<<2)
+#define BM_MV_CUMULATIVECAPA (1<<3)
+#define BM_MV_RESISTANCE    (1<<4)
+#define BM_MV_TEMPERATURE   (1<<5)
+#define BM_MV_UPTIME        (1<<6)
+#define BM_MV_LIFELEFT      (1<<7)
+#define BM_MV_OUTPUTSTATE   (1<<8)
+#define BM_MV_CURRENTDIR    (1<<9)
+#define BM_MV_ALL           0x03ff
+
+// setValues_t
+#define BM_SV_OVPVOLTAGE    (1<<0)
+#define BM_SV_UVPVOLTAGE    (1<<1)
+#define BM_SV_OCPFORWARD    (1<<2)
+#define BM_SV_OCPREVERSE    (1<<3)
+#define BM_SV_OPPPOWER      (1<<4)
+#define BM_SV_PROTTEMP      (1<<5)
+#define BM_SV_RECOVERYTIME  (1<<6)
+#define BM_SV_DELAYTIME     (1<<7)
+#define BM_SV_CAPACITY      (1<<8)
+#define BM_SV_VOLTAGESCALE  (1<<9)
+#define BM_SV_CURRENTSCALE  (1<<10)
+#define BM_SV_RELAYTYPE     (1<<11)
+#define BM_SV_ALL           0x0fff
+
+// basicInfo_t
+#define BM_BI_MAXVOLTAGE    (1<<0)
+#define BM_BI_MAXCURRENT    (1<<1)
+#define BM_BI_SENSORTYPE    (1<<2)
+#define BM_BI_VERSION       (1<<3)
+#define BM_BI_SERIALNUMBER  (1<<4)
+#define BM_BI_ALL           0x001f
+
+typedef enum {
+        exportJson,          // [{"type":"measured","address":1,"voltage":12.50,...},...]
+        exportLineProtocol,  // junctek,address=1,type=measured voltage=12.50,...,uptime=3600i
+        exportCsv            // measured,1,12.50,...
+}exportFormat_t;
+
+typedef enum {
+        snapshotMeasured,
+        snapshotSettings,
+        snapshotInfo
+}snapshotType_t;
+
+/*
+ * SnapshotWriter
+ *
+ * Serializes measuredValues_t, setValues_t and basicInfo_t into a caller
+ * supplied buffer without using String or the heap. Numbers are written from
+ * scaled integers with the resolution the device reports (1/100 V, 1/100 A,
+ * mAh), so no float printf support is needed.
+ *
+ * Every add() appends one record, records of several devices can be batched
+ * into the same buffer. If a record does not fit, it is not written at all,
+ * add() returns false and the buffer still holds all previous records. The
+ * buffer is always NUL terminated and, for JSON, always a complete array.
+ *
+ *   char payload[256];
+ *   SnapshotWriter writer(payload, sizeof(payload), exportJson);
+ *   writer.add(monitor1.getMeasuredSnapshot(), BM_MV_VOLTAGE|BM_MV_CURRENT);
+ *   writer.add(monitor2.getMeasuredSnapshot(), BM_MV_VOLTAGE|BM_MV_CURRENT);
+ *   mqtt.publish(topic, writer.c_str());
+ */
+class SnapshotWriter{
+  public:
+
+  SnapshotWriter(char *buffer, size_t size, exportFormat_t format);
+  ~SnapshotWriter();
+
+  void
+    reset(),
+    setMeasurement(const char *name);    // line protocol measurement name, default "junctek"
+
+  bool
+    add(const measuredValues_t &values, uint16_t mask=BM_MV_ALL),
+    add(const setValues_t &values, uint16_t mask=BM_SV_ALL),
+    add(const basicInfo_t &info, uint16_t mask=BM_BI_ALL),   // false if it doesn't fit or mask selects no field
+    addHeader(snapshotType_t type, uint16_t mask);   // CSV column names, no-op for other formats
+
+  const char
+    *c_str();
+  size_t
+    length();
+
+  private:
+  bool
+    addRecord(snapshotType_t type, const void *values, int address, uint16_t mask),
+    beginRecord(snapshotType_t type, int address),
+    endRecord();
+  void
+    put(char c),
+    put(const char *s),
+    putInt(long value),
+    putFixed(float value, uint8_t decimals),
+    putField(const char *name, const void *values, uint8_t offset, int8_t decimals, bool first);
+
+  char              *buf;
+  size_t            bufSize, len, recordStart;
+  exportFormat_t    format;
+  const char        *measurement;
+  bool              overflow;
+  int               records;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "JuncTek_Pack.h"
+
+BatteryPack::BatteryPack(packTopology_t t){
+  topology=t;
+  staleTime=PACK_STALE_TIME;
+  reset();
+}
+BatteryPack::~BatteryPack(){
+
+}
+
+void BatteryPack::reset(){
+  for(int i=0;i<MAXDEVS;i++){
+    lastUpdate[i]=0;
+    voltage[i]=0;
+    current[i]=0;
+    temperature[i]=0;
+    remaining[i]=0;
+  }
+  voltageSum=0;
+  currentSum=0;
+  minVoltageIdx=-1;
+  maxVoltageIdx=-1;
+  minTempIdx=-1;
+  maxTempIdx=-1;
+  minRemainingIdx=-1;
+  active=0;
+  members=0;
+}
+
+void BatteryPack::setStaleTime(unsigned long sTime){
+  staleTime=sTime;
+}
+
+void BatteryPack::update(int member, const measuredValues_t &values){
+  if(member<0 || member>=MAXDEVS) return;
+
+  int32_t v=bm_voltageCenti(values);
+  int32_t c=bm_currentCenti(values);
+  int32_t r=bm_remainingMah(values);
+
+  bool known=active&(1<<member);
+  int32_t oldV=voltage[member], oldT=temperature[member], oldR=remaining[member];
+
+  if(!known){
+    active|=(1<<member);
+    members++;
+  }else{
+    voltageSum-=oldV;
+    currentSum-=current[member];
+  }
+  voltage[member]=v;
+  current[member]=c;
+  temperature[member]=values.temperature;
+  remaining[member]=r;
+  voltageSum+=v;
+  currentSum+=c;
+  lastUpdate[member]=millis();
+
+  trackMin(minVoltageIdx, voltage, member, known && v>oldV);
+  trackMax(maxVoltageIdx, voltage, member, known && v<oldV);
+  trackMin(minTempIdx, temperature, member, known && temperature[member]>oldT);
+  trackMax(maxTempIdx, temperature, member, known && temperature[member]<oldT);
+  trackMin(minRemainingIdx, remaining, member, known && r>oldR);
+}
+
+void BatteryPack::trackMin(int &idx, const int32_t values[], int member, bool movedUp){
+  if(idx==member && movedUp){
+    // the member holding the minimum went up, someone else may be lower now
+    idx=-1;
+    for(int i=0;i<MAXDEVS;i++){
+      if((active&(1<<i)) && (idx<0 || values[i]<values[idx])) idx=i;
+    }
+  }else if(idx<0 || values[member]<values[idx]){
+    idx=member;
+  }
+}
+
+void BatteryPack::trackMax(int &idx, const int32_t values[], int member, bool movedDown){
+  if(idx==member && movedDown){
+    idx=-1;
+    for(int i=0;i<MAXDEVS;i++){
+      if((active&(1<<i)) && (idx<0 || values[i]>values[idx])) idx=i;
+    }
+  }else if(idx<0 || values[member]>values[idx]){
+    idx=member;
+  }
+}
+
+float BatteryPack::getVoltage(){
+  if(topology==packSeries || members==0) return getSeriesVoltage();
+  return (float)(voltageSum/members)/100;
+}
+float BatteryPack::getCurrent(){
+  if(topology==packParallel || members==0) return getTotalCurrent();
+  return (float)(currentSum/members)/100;
+}
+float BatteryPack::getSeriesVoltage(){
+  return (float)voltageSum/100;
+}
+float BatteryPack::getTotalCurrent(){
+  return (float)currentSum/100;
+}
+float BatteryPack::getMinVoltage(){
+  if(minVoltageIdx<0) return 0;
+  return (float)voltage[minVoltageIdx]/100;
+}
+float BatteryPack::getMaxVoltage(){
+  if(maxVoltageIdx<0) return 0;
+  return (float)voltage[maxVoltageIdx]/100;
+}
+float BatteryPack::getVoltageSpread(){
+  if(members==0) return 0;
+  return (float)(voltage[maxVoltageIdx]-voltage[minVoltageIdx])/100;
+}
+float BatteryPack::getMinRemainingCapacity(){
+  if(minRemainingIdx<0) return 0;
+  return (float)remaining[minRemainingIdx]/1000;
+}
+
+int BatteryPack::getMinTemperature(){
+  if(minTempIdx<0) return 0;
+  return temperature[minTempIdx];
+}
+int BatteryPack::getMaxTemperature(){
+  if(maxTempIdx<0) return 0;
+  return temperature[maxTempIdx];
+}
+int BatteryPack::getTemperatureSpread(){
+  if(members==0) return 0;
+  return temperature[maxTempIdx]-temperature[minTempIdx];
+}
+int BatteryPack::getWeakestMember(){
+  return minRemainingIdx;
+}
+int BatteryPack::getMemberCount(){
+  return members;
+}
+int BatteryPack::getStaleCount(){
+  int stale=0;
+  for(int i=0;i<MAXDEVS;i++){
+    if((active&(1<<i)) && isStale(i)) stale++;
+  }
+  return stale;
+}
+
+bool BatteryPack::isStale(int member){
+  if(member<0 || member>=MAXDEVS) return true;
+  if(!(active&(1<<member))) return true;
+  return millis()-lastUpdate[member]>staleTime;
+}
@@ -0,0 +1,76 @@
+#ifndef _BATTERYPACKH_
+#define _BATTERYPACKH_
+
+#include <Arduino.h>
+#include "JuncTek_BatteryMonitor.h"
+
+#define PACK_STALE_TIME   5000 // a member that has not delivered a new :r50 frame for this many
+										// milliseconds is reported as stale. Set through setStaleTime(millis)
+
+typedef enum {
+        packSeries,     // members are strings in series: voltages add up, current is shared
+        packParallel    // members are parallel banks: currents add up, voltage is shared
+}packTopology_t;
+
+/*
+ * BatteryPack
+ *
+ * Aggregates up to MAXDEVS BatteryMonitors into one virtual pack. Each monitor
+ * is attached with BatteryMonitor::attachPack(&pack, member) and hands every
+ * new :r50 frame to update(). Sums are adjusted by the difference to the
+ * member's previous sample, extremes are only rescanned when the member that
+ * held them moves inwards, so the pack getters never touch the serial line
+ * and cost O(1).
+ *
+ * Members that have not reported yet do not count. Stale members keep
+ * contributing their last values, check isStale()/getStaleCount() before
+ * trusting the pack state.
+ */
+class BatteryPack{
+  public:
+
+  BatteryPack(packTopology_t topology=packSeries);
+  ~BatteryPack();
+
+  void
+    reset(),
+    setStaleTime(unsigned long staleTime),
+    update(int member, const measuredValues_t &values);
+
+  float
+    getVoltage(),              // series: sum of the members, parallel: mean
+    getCurrent(),              // series: mean of the members, parallel: sum
+    getSeriesVoltage(),        // sum of the member voltages
+    getTotalCurrent(),         // sum of the member currents
+    getMinVoltage(),
+    getMaxVoltage(),
+    getVoltageSpread(),
+    getMinRemainingCapacity(); // Ah, of the weakest member
+
+  int
+    getMinTemperature(),
+    getMaxTemperature(),
+    getTemperatureSpread(),
+    getWeakestMember(),        // member with the lowest remaining capacity, -1 if none
+    getMemberCount(),
+    getStaleCount();
+
+  bool
+    isStale(int member);
+
+  private:
+  void
+    trackMin(int &idx, const int32_t values[], int member, bool movedUp),
+    trackMax(int &idx, const int32_t values[], int member, bool movedDown);
+
+  packTopology_t    topology;
+  unsigned long     staleTime;
+  unsigned long     lastUpdate[MAXDEVS];
+  int32_t           voltage[MAXDEVS], current[MAXDEVS], temperature[MAXDEVS], remaining[MAXDEVS];
+  int32_t           voltageSum, currentSum;
+  int               minVoltageIdx, maxVoltageIdx, minTempIdx, maxTempIdx, minRemainingIdx;
+  uint8_t           active;    // bit mask of members that have reported
+  int               members;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "JuncTek_Trace.h"
+
+static const uint8_t traceMagic[4]={'J','T','R','C'};
+
+TraceRecorder::TraceRecorder(Stream &serialDevice, Print &traceOut){
+  bm_serial=&serialDevice;
+  trace=&traceOut;
+  recordLen=0;
+  recordDir=0;
+  recordTime=0;
+  lastRecordTime=0;
+  recordedBytes=0;
+  headerWritten=false;
+  timeBaseSet=false;
+}
+TraceRecorder::~TraceRecorder(){
+
+}
+
+int TraceRecorder::available(){
+  return bm_serial->available();
+}
+
+int TraceRecorder::read(){
+  int c=bm_serial->read();
+  if(c>=0) record(TRACE_RX, (uint8_t)c);
+  return c;
+}
+
+int TraceRecorder::peek(){
+  return bm_serial->peek();
+}
+
+size_t TraceRecorder::write(uint8_t c){
+  record(TRACE_TX, c);
+  return bm_serial->write(c);
+}
+
+void TraceRecorder::flush(){
+  flushRecord();
+  trace->flush();
+  bm_serial->flush();
+}
+
+unsigned long TraceRecorder::getRecordedBytes(){
+  return recordedBytes;
+}
+
+void TraceRecorder::record(uint8_t dir, uint8_t c){
+  unsigned long now=millis();
+  if(recordLen>0 && (dir!=recordDir || now!=recordTime || recordLen==TRACE_RECORD_MAX)){
+    flushRecord();
+  }
+  if(recordLen==0){
+    recordDir=dir;
+    recordTime=now;
+  }
+  recordBuf[recordLen++]=c;
+  recordedBytes++;
+}
+
+void TraceRecorder::flushRecord(){
+  if(!headerWritten){
+    trace->write(traceMagic, sizeof(traceMagic));
+    trace->write((uint8_t)TRACE_VERSION);
+    headerWritten=true;
+  }
+  if(recordLen==0) return;
+  if(!timeBaseSet){
+    // deltas count from the first record, not from when the header was written
+    lastRecordTime=recordTime;
+    timeBaseSet=true;
+  }
+
+  unsigned long delta=recordTime-lastRecordTime;
+  lastRecordTime=recordTime;
+  trace->write((uint8_t)(recordDir|recordLen));
+  do{
+    uint8_t b=delta&0x7f;
+    delta>>=7;
+    if(delta) b|=0x80;
+    trace->write(b);
+  }while(delta);
+  trace->write(recordBuf, recordLen);
+  recordLen=0;
+}
+
+TraceReplay::TraceReplay(const uint8_t *traceData, size_t length, bool rt){
+  trace=traceData;
+  traceLength=length;
+  realTime=rt;
+  rewind();
+}
+TraceReplay::~TraceReplay(){
+
+}
+
+void TraceReplay::rewind(){
+  valid=traceLength>sizeof(traceMagic) && memcmp(trace, traceMagic, sizeof(traceMagic))==0
+        && trace[sizeof(traceMagic)]==TRACE_VERSION;
+  pos=sizeof(traceMagic)+1;
+  recordLeft=0;
+  recordTime=0;
+  txMismatches=0;
+  started=false;
+  if(valid) nextRecord();
+}
+
+bool TraceReplay::isValid(){
+  return valid;
+}
+
+bool TraceReplay::finished(){
+  return recordLeft==0;
+}
+
+int TraceReplay::getTxMismatches(){
+  return txMismatches;
+}
+
+int TraceReplay::available(){
+  if(recordDir!=TRACE_RX || !rxDue()) return 0;
+  return recordLeft;
+}
+
+int TraceReplay::read(){
+  if(available()==0) return -1;
+  uint8_t c=trace[pos++];
+  if(--recordLeft==0) nextRecord();
+  return c;
+}
+
+int TraceReplay::peek(){
+  if(available()==0) return -1;
+  return trace[pos];
+}
+
+size_t TraceReplay::write(uint8_t c){
+  if(!started){
+    startTime=millis();
+    started=true;
+  }
+  if(recordLeft==0 || recordDir==TRACE_RX){
+    // the library sent something that isn't in the trace at this point
+    txMismatches++;
+    return 1;
+  }
+  if(trace[pos++]!=c) txMismatches++;
+  if(--recordLeft==0) nextRecord();
+  return 1;
+}
+
+void TraceReplay::flush(){
+
+}
+
+bool TraceReplay::nextRecord(){
+  recordLeft=0;
+  if(pos>=traceLength) return false;
+
+  uint8_t tag=trace[pos++];
+  unsigned long delta=0;
+  uint8_t shift=0;
+  bool more=true;
+  while(more){
+    // a delta that doesn't end before the trace or overflows 32 bits is corrupt
+    if(pos>=traceLength || shift>=32) return false;
+    uint8_t b=trace[pos++];
+    delta|=(unsigned long)(b&0x7f)<<shift;
+    shift+=7;
+    more=b&0x80;
+  }
+  uint8_t len=tag&~TRACE_RX;
+  if(len==0 || pos+len>traceLength) return false;    // truncated trace
+
+  recordDir=tag&TRACE_RX;
+  recordLeft=len;
+  recordTime+=delta;
+  return true;
+}
+
+bool TraceReplay::rxDue(){
+  if(!realTime) return true;
+  if(!started){
+    // a trace may start with RX bytes (e.g. leftovers flushed before the first request)
+    startTime=millis();
+    started=true;
+  }
+  return millis()-startTime>=recordTime;
+}
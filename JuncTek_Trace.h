@@ -0,0 +1,122 @@
+#ifndef _BATTERYMONITORTRACEH_
+#define _BATTERYMONITORTRACEH_
+
+#ifndef Stream_h
+#include <Stream.h>
+#endif
+
+#include <Arduino.h>
+
+#define TRACE_VERSION     1
+#define TRACE_RX          0x80  // direction flag in the record tag, bytes read from the device
+#define TRACE_TX          0x00  // bytes written to the device
+#define TRACE_RECORD_MAX  127   // max payload of a single record
+
+/* Trace format:
+ *
+ *  header        "JTRC" <version>
+ *  records       <tag> <delta> <payload>
+ *
+ *  tag           bit 7:   direction, 1 = RX (device -> library), 0 = TX (library -> device)
+ *                bit 0-6: payload length, 1-127
+ *  delta         milliseconds since the previous record, unsigned LEB128 (1 byte for < 128ms)
+ *  payload       the raw bytes
+ *
+ * Consecutive bytes in the same direction within the same millisecond are
+ * merged into one record, so a 115200 baud reply costs ~2 bytes of overhead
+ * per millisecond of traffic.
+ */
+
+/*
+ * TraceRecorder
+ *
+ * Sits between a BatteryMonitor and its serial port and writes every byte
+ * that crosses it to a Print (an SD card file, a second serial port, a RAM
+ * buffer...). RX bytes are time stamped when the library reads them.
+ *
+ *   TraceRecorder recorder(Serial2, traceFile);
+ *   monitor.begin(1, recorder);
+ *
+ * Call flush() before closing the trace to write out the last record.
+ */
+class TraceRecorder : public Stream{
+  public:
+
+  TraceRecorder(Stream &serialDevice, Print &trace);
+  ~TraceRecorder();
+
+  int
+    available(),
+    read(),
+    peek();
+  size_t
+    write(uint8_t c);
+  void
+    flush();
+  unsigned long
+    getRecordedBytes();
+
+  using Print::write;
+
+  private:
+  void
+    record(uint8_t dir, uint8_t c),
+    flushRecord();
+
+  Stream            *bm_serial;
+  Print             *trace;
+  uint8_t           recordBuf[TRACE_RECORD_MAX];
+  uint8_t           recordLen, recordDir;
+  unsigned long     recordTime, lastRecordTime, recordedBytes;
+  bool              headerWritten, timeBaseSet;
+};
+
+/*
+ * TraceReplay
+ *
+ * A Stream that plays a recorded trace back into a BatteryMonitor, e.g. on a
+ * host build for regression tests or as a parser benchmark. RX bytes of a
+ * record become available once the library has written all TX bytes that
+ * preceded them in the trace. In real time mode they are additionally held
+ * back until their recorded time offset has passed, otherwise the trace is
+ * played as fast as the library consumes it.
+ *
+ * Bytes the library writes are compared against the recorded TX bytes, a
+ * difference is counted in getTxMismatches().
+ */
+class TraceReplay : public Stream{
+  public:
+
+  TraceReplay(const uint8_t *trace, size_t length, bool realTime=false);
+  ~TraceReplay();
+
+  int
+    available(),
+    read(),
+    peek(),
+    getTxMismatches();
+  size_t
+    write(uint8_t c);
+  void
+    flush(),
+    rewind();
+  bool
+    isValid(),
+    finished();
+
+  using Print::write;
+
+  private:
+  bool
+    nextRecord(),
+    rxDue();
+
+  const uint8_t     *trace;
+  size_t            traceLength, pos;
+  bool              realTime, started, valid;
+  uint8_t           recordDir, recordLeft;
+  unsigned long     recordTime, startTime;
+  int               txMismatches;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * JuncTek Battery Monitor trace replay
+ *
+ * Plays a trace recorded with TraceRecorder back into the library, checks
+ * that the library sent the same requests and parsed the expected values,
+ * and then replays it repeatedly as fast as possible to measure the
+ * throughput of the receive path and parser.
+ *
+ * No battery monitor is needed. The sketch runs on a board or on Linux
+ * through a host Arduino core such as EpoxyDuino, where it exits with a
+ * non-zero status if the regression check fails.
+ *
+ * To replay your own traffic, record it with
+ *   TraceRecorder recorder(Serial2, traceFile);
+ *   monitor.begin(1, recorder);
+ * and paste the file contents into trace[] below (e.g. with xxd -i).
+ */
+
+#include "JuncTek_BatteryMonitor.h"
+#include "JuncTek_Trace.h"
+#include "JuncTek_DerivedMetrics.h"
+
+#define BENCHMARK_PASSES 100
+
+// synthetic trace: begin() (:r00, :r51, :r50) followed by seven :r50 polls,
+// the third reply is preceded by two bytes of line noise
+const uint8_t trace[] = {
+  0x4a, 0x54, 0x52, 0x43, 0x01, 0x0d, 0x00, 0x3a, 0x52, 0x30, 0x30, 0x3d, 0x31, 0x2c, 0x32, 0x2c,
+  0x31, 0x2c, 0x0d, 0x0a, 0x9a, 0x00, 0x3a, 0x72, 0x30, 0x30, 0x3d, 0x31, 0x2c, 0x31, 0x2c, 0x31,
+  0x31, 0x32, 0x30, 0x2c, 0x31, 0x30, 0x30, 0x2c, 0x31, 0x32, 0x33, 0x34, 0x35, 0x2c, 0x0d, 0x0a,
+  0x0d, 0x00, 0x3a, 0x52, 0x35, 0x31, 0x3d, 0x31, 0x2c, 0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xc6,
+  0x00, 0x3a, 0x72, 0x35, 0x31, 0x3d, 0x31, 0x2c, 0x35, 0x35, 0x2c, 0x31, 0x34, 0x34, 0x30, 0x2c,
+  0x31, 0x30, 0x30, 0x30, 0x2c, 0x35, 0x30, 0x30, 0x30, 0x2c, 0x35, 0x30, 0x30, 0x30, 0x2c, 0x31,
+  0x30, 0x30, 0x30, 0x30, 0x2c, 0x31, 0x36, 0x30, 0x2c, 0x31, 0x30, 0x2c, 0x31, 0x2c, 0x31, 0x30,
+  0x30, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x31, 0x30, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x31,
+  0x2c, 0x31, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d, 0x31, 0x2c,
+  0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31, 0x2c, 0x32,
+  0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x30, 0x2c, 0x31, 0x30, 0x30, 0x30, 0x2c, 0x35, 0x30, 0x30,
+  0x30, 0x30, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30, 0x2c, 0x33,
+  0x36, 0x30, 0x30, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x33, 0x30,
+  0x30, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d, 0x31, 0x2c,
+  0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31, 0x2c, 0x32,
+  0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x31, 0x2c, 0x31, 0x30, 0x30, 0x35, 0x2c, 0x34, 0x39, 0x39,
+  0x39, 0x37, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30, 0x2c, 0x33,
+  0x36, 0x30, 0x31, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x32, 0x39,
+  0x39, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d, 0x31, 0x2c,
+  0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xc1, 0x00, 0x7f, 0x13, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31,
+  0x2c, 0x32, 0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x32, 0x2c, 0x31, 0x30, 0x31, 0x30, 0x2c, 0x34,
+  0x39, 0x39, 0x39, 0x34, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30,
+  0x2c, 0x33, 0x36, 0x30, 0x32, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c,
+  0x32, 0x39, 0x38, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d,
+  0x31, 0x2c, 0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31,
+  0x2c, 0x32, 0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x33, 0x2c, 0x31, 0x30, 0x31, 0x35, 0x2c, 0x34,
+  0x39, 0x39, 0x39, 0x31, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30,
+  0x2c, 0x33, 0x36, 0x30, 0x33, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c,
+  0x32, 0x39, 0x37, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d,
+  0x31, 0x2c, 0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31,
+  0x2c, 0x32, 0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x34, 0x2c, 0x31, 0x30, 0x32, 0x30, 0x2c, 0x34,
+  0x39, 0x39, 0x38, 0x38, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30,
+  0x2c, 0x33, 0x36, 0x30, 0x34, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c,
+  0x32, 0x39, 0x36, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d,
+  0x31, 0x2c, 0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31,
+  0x2c, 0x32, 0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x35, 0x2c, 0x31, 0x30, 0x32, 0x35, 0x2c, 0x34,
+  0x39, 0x39, 0x38, 0x35, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30,
+  0x2c, 0x33, 0x36, 0x30, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c,
+  0x32, 0x39, 0x35, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d,
+  0x31, 0x2c, 0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31,
+  0x2c, 0x32, 0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x36, 0x2c, 0x31, 0x30, 0x33, 0x30, 0x2c, 0x34,
+  0x39, 0x39, 0x38, 0x32, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30,
+  0x2c, 0x33, 0x36, 0x30, 0x36, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c,
+  0x32, 0x39, 0x34, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a, 0x0d, 0x00, 0x3a, 0x52, 0x35, 0x30, 0x3d,
+  0x31, 0x2c, 0x32, 0x2c, 0x31, 0x2c, 0x0d, 0x0a, 0xbf, 0x00, 0x3a, 0x72, 0x35, 0x30, 0x3d, 0x31,
+  0x2c, 0x32, 0x31, 0x35, 0x2c, 0x31, 0x32, 0x35, 0x37, 0x2c, 0x31, 0x30, 0x33, 0x35, 0x2c, 0x34,
+  0x39, 0x39, 0x37, 0x39, 0x2c, 0x31, 0x32, 0x30, 0x30, 0x30, 0x2c, 0x36, 0x34, 0x30, 0x30, 0x30,
+  0x2c, 0x33, 0x36, 0x30, 0x37, 0x2c, 0x31, 0x32, 0x35, 0x2c, 0x30, 0x2c, 0x30, 0x2c, 0x30, 0x2c,
+  0x32, 0x39, 0x33, 0x2c, 0x31, 0x32, 0x2c, 0x0d, 0x0a,
+};
+
+// values of the last :r50 frame in the trace
+#define EXPECTED_VOLTAGE  12.57
+#define EXPECTED_UPTIME   3607
+
+BatteryMonitor monitor;
+BatteryMetrics metrics;              // only used to count the :r50 frames that were parsed
+
+int replayOnce(TraceReplay &replay){
+  int polls=0;
+  replay.rewind();
+  metrics.reset();
+  monitor.attachMetrics(&metrics);
+  monitor.begin(1, replay);
+  monitor.setCacheTime(0);           // every getMeasuredValues() is a new transaction
+  while(!replay.finished() && polls<1000){
+    monitor.getMeasuredValues();
+    polls++;
+  }
+  // the trace is used up, let the getters below answer from the cache
+  monitor.setCacheTime(CACHE_TIME);
+  return metrics.getSampleCount();
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+
+  Serial.println("JuncTek Battery Monitor trace replay");
+  Serial.println("====================================");
+
+  // regression: replay once and check what the library made of it
+  TraceReplay replay(trace, sizeof(trace));
+  if(!replay.isValid()){
+    Serial.println("✗ not a valid trace");
+  }
+  int frames=replayOnce(replay);
+  bool pass=replay.isValid()
+    && replay.finished()
+    && replay.getTxMismatches()==0
+    && (int)(monitor.getVoltage()*100+0.5)==(int)(EXPECTED_VOLTAGE*100+0.5)
+    && monitor.getUptime()==EXPECTED_UPTIME;
+
+  Serial.print("Frames replayed: ");
+  Serial.println(frames);
+  Serial.print("TX mismatches: ");
+  Serial.println(replay.getTxMismatches());
+  Serial.print("Last voltage: ");
+  Serial.print(monitor.getVoltage(), 2);
+  Serial.println(" V");
+  Serial.println(pass ? "✓ replay matches" : "✗ replay differs from the recording");
+
+  // benchmark: replay as fast as the library consumes the trace
+  unsigned long t_start=micros();
+  long total=0;
+  for(int i=0;i<BENCHMARK_PASSES;i++){
+    total+=replayOnce(replay);
+  }
+  unsigned long elapsed=micros()-t_start;
+
+  Serial.print("Parsed ");
+  Serial.print(total);
+  Serial.print(" frames in ");
+  Serial.print(elapsed);
+  Serial.println(" us");
+  Serial.print("Frames per second: ");
+  Serial.println(elapsed>0 ? (unsigned long)(total*1000000.0/elapsed) : 0UL);
+
+  #if defined(EPOXY_DUINO)
+  exit(pass ? 0 : 1);
+  #endif
+}
+
+void loop() {
+}